@@ -0,0 +1,87 @@
+// GCC-style bandwidth estimation from webrtcbin's TWCC statistics, shared
+// by the multi-client server and the single-peer sender.
+#ifndef WEBRTC_BWE_H
+#define WEBRTC_BWE_H
+
+#include <gst/gst.h>
+
+// Poll interval, delay-gradient threshold and encoder hysteresis
+#define BWE_INTERVAL_MS         500
+// Average delta-of-delta treated as queue build-up (or drain)
+#define BWE_OVERUSE_NS          (2 * GST_MSECOND)
+// Smallest relative change applied to the encoder, in percent
+#define BWE_HYSTERESIS_PCT      10
+// Minimum time after any change before the encoder may be raised again
+#define BWE_INCREASE_HOLD_US    (3 * G_USEC_PER_SEC)
+
+#define TWCC_CAPS ",rtcp-fb-transport-cc=(boolean)true," \
+                  "extmap-1=(string)http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01"
+
+// Estimate for one transport, fed by TWCC feedback
+struct BandwidthEstimator {
+    gint64 estimate_bps;
+    gint64 last_update_us;
+    gboolean valid;
+
+    BandwidthEstimator() : estimate_bps(0), last_update_us(0), valid(FALSE) {}
+};
+
+// Back off to 85% of the received rate when the one-way delay gradient says
+// queues are building, cut on heavy loss, and otherwise probe upwards by
+// ~8%/s. Returns FALSE when the stats carry no feedback yet.
+static gboolean bwe_update(BandwidthEstimator *bwe, const GstStructure *twcc,
+                           gint64 min_bps, gint64 max_bps) {
+    guint packets_recv = 0, recv_bps = 0;
+    gdouble loss_pct = 0;
+    gint64 dod_ns = 0;
+
+    if (!gst_structure_get_uint(twcc, "packets-recv", &packets_recv) || packets_recv == 0) return FALSE;
+    gst_structure_get_uint(twcc, "bitrate-recv", &recv_bps);
+    gst_structure_get_double(twcc, "packet-loss-pct", &loss_pct);
+    gst_structure_get_int64(twcc, "avg-delta-of-delta", &dod_ns);
+
+    gint64 now = g_get_monotonic_time();
+    if (!bwe->valid) {
+        bwe->estimate_bps = max_bps;
+        bwe->last_update_us = now;
+        bwe->valid = TRUE;
+    }
+    gdouble dt = (now - bwe->last_update_us) / 1e6;
+    bwe->last_update_us = now;
+
+    gint64 est = bwe->estimate_bps;
+    if (dod_ns > BWE_OVERUSE_NS) {
+        est = MIN(est, (gint64)(0.85 * (recv_bps ? recv_bps : est)));
+    } else if (loss_pct > 10.0) {
+        est = (gint64)(est * (1.0 - 0.5 * loss_pct / 100.0));
+    } else if (dod_ns >= -BWE_OVERUSE_NS && loss_pct < 2.0) {
+        gint64 probed = est + (gint64)(est * 0.08 * dt);
+        // Do not run far ahead of what is actually getting through
+        if (recv_bps) probed = MIN(probed, (gint64)(1.5 * recv_bps) + 10000);
+        est = MAX(est, probed);
+    }
+    // Draining queues or moderate loss: hold
+
+    bwe->estimate_bps = CLAMP(est, min_bps, max_bps);
+    return TRUE;
+}
+
+// twcc-stats is a property of the GstRtpSession element rtpbin hands out
+// through "get-session", not of the RTPSession behind it.
+static GstStructure* webrtc_twcc_stats(GstElement *webrtc) {
+    GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(webrtc), "rtpbin");
+    if (!rtpbin) return NULL;
+
+    // Everything is bundled onto session 0
+    GstElement *session = NULL;
+    GstStructure *stats = NULL;
+    g_signal_emit_by_name(rtpbin, "get-session", 0, &session);
+    if (session) {
+        g_object_get(session, "twcc-stats", &stats, NULL);
+        gst_object_unref(session);
+    }
+    gst_object_unref(rtpbin);
+    return stats;
+}
+
+#endif // WEBRTC_BWE_H
@@ -0,0 +1,1826 @@
+// Self-checks and benchmarks for the multi-client WebRTC server, kept out of
+// the server binary. The server source is compiled in whole, without its
+// main(), so each check drives the same code the server runs.
+// Build: g++ -std=c++17 -o webrtc_multicast_bench multiclient_bench.cpp `pkg-config --cflags --libs
+//        gstreamer-1.0 gstreamer-webrtc-1.0 gstreamer-sdp-1.0 gstreamer-rtp-1.0 libsoup-2.4 json-glib-1.0
+//        glib-2.0 gio-2.0`
+// Usage: webrtc_multicast_bench --bench-rtx, or e.g. --soak=20 followed by
+// any server options
+
+#define WEBRTC_SERVER_NO_MAIN
+#include "multiclientfix.cpp"
+
+// ==================== Bench Options ====================
+
+struct BenchConfig {
+    gboolean meter;
+    gboolean rtx;
+    gboolean pacer;
+    gboolean opus;
+    gboolean log;
+    gboolean candidates;
+    gboolean stress_registry;
+    gboolean signaling;
+    // Add/remove cycles of synthetic peers before checking for leaks; 0 off
+    gint soak_cycles;
+    // Synthetic viewers per subscription mix for --bench-media; 0 off
+    gint media;
+    // Most shared-memory readers of one publisher for --bench-shm; 0 off
+    gint shm;
+    // Viewers joined over loopback for --bench-join; 0 off
+    gint join;
+};
+
+static BenchConfig bench_config;
+
+// ==================== Offline Benches ====================
+
+// --bench-candidates: check the parser on well-formed candidates against
+// inet_pton and on random corruptions of them, then time it
+static int candidate_bench() {
+    const gint rounds = 200000;
+    static const char* const templates[] = {
+        "candidate:%u 1 UDP %u %s %u typ %s",
+        "candidate:%u 1 TCP %u %s %u typ %s tcptype passive",
+        "a=candidate:%u 2 udp %u %s %u typ %s raddr 0.0.0.0 rport 0 generation 0",
+    };
+    GRand *rng = g_rand_new_with_seed(1);
+    std::vector<std::string> lines;
+    gint failures = 0;
+
+    for (gint i = 0; i < rounds; i++) {
+        guint8 raw[16];
+        gchar address[INET6_ADDRSTRLEN];
+        gint family = g_rand_int_range(rng, 0, 3) == 0 ? AF_INET6 : AF_INET;
+        for (guint8& byte : raw) byte = (guint8)g_rand_int(rng);
+        // Bias towards the ranges the matcher has to get right
+        if (g_rand_boolean(rng)) memcpy(raw, private_ranges[g_rand_int_range(rng, 0, 6)].prefix, 2);
+        inet_ntop(family, raw, address, sizeof(address));
+        gint type = g_rand_int_range(rng, CANDIDATE_HOST, CANDIDATE_TYPE_COUNT);
+        guint32 priority = g_rand_int(rng);
+        guint port = g_rand_int_range(rng, 0, 65536);
+        gint shape = g_rand_int_range(rng, 0, 3);
+
+        gchar *line = g_strdup_printf(templates[shape], (guint)i, priority, address, port,
+                                      candidate_type_names[type]);
+        CandidateInfo cand;
+        gboolean expected_private = FALSE;
+        for (const CidrRange& range : private_ranges) {
+            if (range.family != family) continue;
+            guint bits = range.bits;
+            guint mismatched = 0;
+            for (guint b = 0; b < bits; b++) {
+                guint8 bit = 0x80 >> (b % 8);
+                if ((raw[b / 8] & bit) != (range.prefix[b / 8] & bit)) mismatched++;
+            }
+            if (!mismatched) expected_private = TRUE;
+        }
+        if (!candidate_parse(line, &cand) || cand.family != family ||
+            memcmp(cand.address, raw, family == AF_INET ? 4 : 16) != 0 || cand.port != port ||
+            cand.priority != priority || cand.type != type || cand.tcp != (shape == 1) ||
+            cand.component != (shape == 2 ? 2u : 1u) || candidate_is_private(cand) != expected_private) {
+            if (failures++ < 5) g_printerr("Mismatch: %s\n", line);
+        }
+        lines.push_back(line);
+        g_free(line);
+    }
+
+    // Whatever the corruption, parsing must stay inside the string and
+    // leave the struct consistent
+    for (gint i = 0; i < rounds; i++) {
+        std::string line = lines[i];
+        gint edits = g_rand_int_range(rng, 1, 4);
+        for (gint e = 0; e < edits && !line.empty(); e++) {
+            gsize at = g_rand_int_range(rng, 0, (gint32)line.size());
+            switch (g_rand_int_range(rng, 0, 4)) {
+                case 0: line[at] = (char)g_rand_int_range(rng, 1, 256); break;
+                case 1: line.resize(at); break;
+                case 2: line.insert(at, 1, ' '); break;
+                default: line.erase(at, 1); break;
+            }
+        }
+        CandidateInfo cand;
+        if (candidate_parse(line.c_str(), &cand) &&
+            (cand.type >= CANDIDATE_TYPE_COUNT || cand.component == 0 || cand.component > 256 ||
+             strlen(cand.foundation) >= sizeof(cand.foundation) ||
+             (cand.family == AF_UNSPEC && candidate_is_private(cand)))) {
+            if (failures++ < 5) g_printerr("Inconsistent parse: %s\n", line.c_str());
+        }
+    }
+    g_rand_free(rng);
+
+    struct timespec start, end;
+    guint checksum = 0;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for (const std::string& line : lines) {
+        CandidateInfo cand;
+        if (candidate_parse(line.c_str(), &cand)) checksum += cand.type + candidate_is_private(cand);
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+
+    gdouble ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / lines.size();
+    g_print("Candidate parse + classify: %.1f ns per candidate (checksum %u), %d failures\n",
+            ns, checksum, failures);
+    return failures ? 1 : 0;
+}
+
+#define LOG_BENCH_MAX_THREADS 8
+
+struct LogBenchProducer {
+    gint lines;
+    gint64 elapsed_us;
+};
+
+static std::atomic<gboolean> log_bench_go(FALSE);
+
+static gpointer log_bench_producer(gpointer data) {
+    LogBenchProducer *producer = static_cast<LogBenchProducer*>(data);
+    while (!log_bench_go.load(std::memory_order_acquire)) g_thread_yield();
+    gint64 start = g_get_monotonic_time();
+    for (gint i = 0; i < producer->lines; i++) {
+        server_log(LOG_INFO, "bench0000", "✓ Sending LAN host candidate (%d)", i);
+    }
+    producer->elapsed_us = g_get_monotonic_time() - start;
+    return NULL;
+}
+
+// 1, 2, 4 and 8 threads logging flat out into one queue: total throughput,
+// per-line cost on each caller, and how much the single writer had to
+// drop. Every line must come out written or counted as dropped.
+static gint log_bench_contention(gint lines) {
+    gint failures = 0;
+    for (gint threads = 1; threads <= LOG_BENCH_MAX_THREADS; threads *= 2) {
+        LogBenchProducer producers[LOG_BENCH_MAX_THREADS];
+        GThread *handles[LOG_BENCH_MAX_THREADS];
+        guint64 dropped_before = log_queue.dropped.load();
+        guint64 written_before = log_queue.dequeue_pos;
+
+        log_bench_go.store(FALSE, std::memory_order_relaxed);
+        log_start();
+        for (gint t = 0; t < threads; t++) {
+            producers[t].lines = lines;
+            producers[t].elapsed_us = 0;
+            handles[t] = g_thread_new("log-bench", log_bench_producer, &producers[t]);
+        }
+        gint64 start = g_get_monotonic_time();
+        log_bench_go.store(TRUE, std::memory_order_release);
+        gint64 caller_us = 0;
+        for (gint t = 0; t < threads; t++) {
+            g_thread_join(handles[t]);
+            caller_us += producers[t].elapsed_us;
+        }
+        gint64 wall_us = MAX(g_get_monotonic_time() - start, (gint64)1);
+        log_stop();
+
+        guint64 total = (guint64)lines * threads;
+        guint64 dropped = log_queue.dropped.load() - dropped_before;
+        guint64 written = log_queue.dequeue_pos - written_before;
+        gboolean consistent = written + dropped == total;
+        if (!consistent) failures++;
+        fprintf(stderr, "Logging from %d thread%s: %.2f M lines/s offered, %.2f us/line per caller, "
+                "%.1f%% dropped%s\n",
+                threads, threads > 1 ? "s" : " ", total / (gdouble)wall_us, (gdouble)caller_us / total,
+                100.0 * dropped / total, consistent ? "" : ", ✗ lines lost");
+    }
+    return failures;
+}
+
+// Calling-thread cost of a join's worth of lines, written synchronously
+// and through the queue, with stdout sent to /dev/null; then the queue
+// under contention
+static int log_bench() {
+    const gint lines = 20000;
+    config.log_rate = 0;
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+
+    gint64 start = g_get_monotonic_time();
+    for (gint i = 0; i < lines; i++) {
+        g_print("[Server] ✓ Sending LAN host candidate to %s\n", "bench0000");
+    }
+    gint64 sync_us = g_get_monotonic_time() - start;
+
+    log_start();
+    start = g_get_monotonic_time();
+    for (gint i = 0; i < lines; i++) {
+        server_log(LOG_INFO, "bench0000", "✓ Sending LAN host candidate (%d)", i);
+    }
+    gint64 async_us = g_get_monotonic_time() - start;
+    log_stop();
+
+    config.log_rate = 20;
+    log_start();
+    start = g_get_monotonic_time();
+    for (gint i = 0; i < lines; i++) {
+        server_log(LOG_INFO, "bench0000", "✓ Sending LAN host candidate (%d)", i);
+    }
+    gint64 limited_us = g_get_monotonic_time() - start;
+    log_stop();
+
+    fprintf(stderr, "Logging %d lines, calling thread: g_print %.2f us/line, queued %.2f us/line "
+            "(%" G_GUINT64_FORMAT " dropped), rate-limited %.2f us/line\n",
+            lines, (gdouble)sync_us / lines, (gdouble)async_us / lines,
+            (guint64)log_queue.dropped.load(), (gdouble)limited_us / lines);
+
+    config.log_rate = 0;
+    return log_bench_contention(lines * 5) ? 1 : 0;
+}
+
+// --stress-registry: threads insert, look up, lock, snapshot and remove an
+// overlapping set of ids, racing re-inserts against removals. Afterwards
+// every entry must sit in its own shard under its own id, peer_count must
+// match the shards, and the only live PeerStates must be the registry's.
+#define REGISTRY_STRESS_THREADS 8
+#define REGISTRY_STRESS_OPS 200000
+#define REGISTRY_STRESS_IDS 512
+
+static std::atomic<gint> registry_stress_errors(0);
+
+static gpointer registry_stress_main(gpointer data) {
+    GRand *rng = g_rand_new_with_seed(GPOINTER_TO_UINT(data));
+    for (gint i = 0; i < REGISTRY_STRESS_OPS; i++) {
+        gchar id[16];
+        g_snprintf(id, sizeof(id), "stress%03u", (guint)g_rand_int_range(rng, 0, REGISTRY_STRESS_IDS));
+        gint op = g_rand_int_range(rng, 0, 100);
+        if (op < 30) {
+            PeerState *peer = new PeerState();
+            peer->peer_id = id;
+            peer_registry_insert(peer);
+        } else if (op < 60) {
+            PeerRef peer = peer_registry_lookup(id);
+            if (peer) {
+                PeerLock lock(peer.get());
+                if (peer->peer_id != id) registry_stress_errors.fetch_add(1);
+                peer->stats_us++;
+            }
+        } else if (op < 99) {
+            PeerRef peer = peer_registry_lookup(id);
+            if (peer) peer_registry_remove(peer.get());
+        } else {
+            for (const PeerRef& peer : peer_registry_snapshot()) {
+                if (peer->peer_id.compare(0, 6, "stress") != 0) registry_stress_errors.fetch_add(1);
+            }
+        }
+    }
+    g_rand_free(rng);
+    return NULL;
+}
+
+static int registry_stress() {
+    GThread *threads[REGISTRY_STRESS_THREADS];
+    gint64 start = g_get_monotonic_time();
+    for (gint i = 0; i < REGISTRY_STRESS_THREADS; i++) {
+        threads[i] = g_thread_new("stress", registry_stress_main, GUINT_TO_POINTER(i + 1));
+    }
+    for (GThread *thread : threads) g_thread_join(thread);
+    gint64 elapsed_us = g_get_monotonic_time() - start;
+
+    gint errors = registry_stress_errors.load();
+    gint entries = 0;
+    guint64 acquisitions = 0, contended = 0;
+    for (auto& shard : peer_shards) {
+        acquisitions += shard.stats.acquisitions.load();
+        contended += shard.stats.contended.load();
+        CountedLock guard(shard.lock, shard.stats);
+        for (auto& pair : shard.peers) {
+            if (pair.first != pair.second->peer_id || &peer_shard_for(pair.first) != &shard ||
+                pair.second->ref_count.load() != 1) {
+                if (errors++ < 5) g_printerr("Bad entry %s\n", pair.first.c_str());
+            }
+            entries++;
+        }
+    }
+    if (entries != peer_count.load() || entries != PeerState::live_objects.load()) {
+        g_printerr("Registry holds %d entries, peer_count %d, live PeerStates %d\n",
+                   entries, peer_count.load(), PeerState::live_objects.load());
+        errors++;
+    }
+    peer_registry_clear();
+    if (peer_count.load() != 0 || PeerState::live_objects.load() != 0) {
+        g_printerr("After clear: peer_count %d, live PeerStates %d\n",
+                   peer_count.load(), PeerState::live_objects.load());
+        errors++;
+    }
+
+    g_print("Registry stress: %d threads x %d ops in %.1f ms (%.0f ns/op per thread), %d entries left, "
+            "shard locks %" G_GUINT64_FORMAT " (%.2f%% contended), peer locks %.2f%% contended, "
+            "%d errors\n",
+            REGISTRY_STRESS_THREADS, REGISTRY_STRESS_OPS, elapsed_us / 1000.0,
+            elapsed_us * 1000.0 / REGISTRY_STRESS_OPS,
+            entries, acquisitions, acquisitions ? 100.0 * contended / acquisitions : 0.0,
+            peer_lock_stats.acquisitions.load() ?
+                100.0 * peer_lock_stats.contended.load() / peer_lock_stats.acquisitions.load() : 0.0,
+            errors);
+    return errors ? 1 : 0;
+}
+
+// --bench-rtx: 10 s of 2 Mbps video through one store with 1, 10 and 100
+// simulated viewers, each losing 2% of packets and NACKing them one RTT
+// later. The store's size must not move with the viewer count and every
+// NACK inside the window must be answered.
+static int rtx_bench() {
+    const gint bitrate_bps = 2000000, packet_bytes = 1200, seconds = 10, loss_pct = 2, rtt_ms = 50;
+    static const gint viewer_counts[] = { 1, 10, 100 };
+    if (config.rtx_window_ms <= 0) config.rtx_window_ms = 1000;
+    gint packets_per_s = bitrate_bps / 8 / packet_bytes;
+    gint64 interval_us = G_USEC_PER_SEC / packets_per_s;
+    guint64 expected = (guint64)bitrate_bps / 8 * config.rtx_window_ms / 1000;
+    guint64 first_peak = 0;
+    gint failures = 0;
+
+    for (gint viewers : viewer_counts) {
+        RtxStore store;
+        GRand *rng = g_rand_new_with_seed(viewers);
+        // Due time and sequence number, in due order
+        std::deque<std::pair<gint64, guint16>> nacks;
+        guint64 peak = 0, requests = 0, hits = 0;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+        for (gint i = 0; i < seconds * packets_per_s; i++) {
+            gint64 now_us = i * interval_us;
+            GstBuffer *buffer = gst_rtp_buffer_new_allocate(packet_bytes - 12, 0, 0);
+            GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+            gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp);
+            gst_rtp_buffer_set_seq(&rtp, (guint16)i);
+            gst_rtp_buffer_unmap(&rtp);
+            rtx_store_add(&store, buffer, now_us);
+            gst_buffer_unref(buffer);
+            peak = MAX(peak, store.bytes.load(std::memory_order_relaxed));
+
+            for (gint v = 0; v < viewers; v++) {
+                if (g_rand_int_range(rng, 0, 100) < loss_pct) {
+                    nacks.push_back(std::make_pair(now_us + rtt_ms * 1000, (guint16)i));
+                }
+            }
+            while (!nacks.empty() && nacks.front().first <= now_us) {
+                GstBuffer *hit = rtx_store_lookup(&store, nacks.front().second);
+                requests++;
+                if (hit) {
+                    hits++;
+                    gst_buffer_unref(hit);
+                }
+                nacks.pop_front();
+            }
+        }
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+        rtx_store_clear(&store);
+        g_rand_free(rng);
+
+        gdouble cpu_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        g_print("RTX store, %3d viewers: peak %" G_GUINT64_FORMAT " KiB (per-viewer buffers: %"
+                G_GUINT64_FORMAT " KiB), %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " NACKs answered, "
+                "%.1f ms CPU\n",
+                viewers, peak / 1024, peak * viewers / 1024, hits, requests, cpu_ms);
+        if (viewers == viewer_counts[0]) first_peak = peak;
+        if (peak != first_peak || hits != requests) failures++;
+    }
+
+    // Packet granularity and the RTP header put it a little off the ideal
+    g_print("Expected about %" G_GUINT64_FORMAT " KiB for %d kbps over %d ms\n",
+            expected / 1024, bitrate_bps / 1000, config.rtx_window_ms);
+    if (first_peak < expected * 9 / 10 || first_peak > expected * 11 / 10) failures++;
+    return failures ? 1 : 0;
+}
+
+// --bench-meter: meter a minute of synthetic 48 kHz stereo in 10 ms buffers
+static int audio_meter_bench() {
+    const gint frames = 480, channels = 2, seconds = 60;
+    std::vector<gint16> buffer(frames * channels);
+    for (gint i = 0; i < frames; i++) {
+        gint16 v = (gint16)(8000.0 * sin(2.0 * G_PI * 440.0 * i / 48000.0)) + g_random_int_range(-200, 200);
+        buffer[i * 2] = buffer[i * 2 + 1] = v;
+    }
+
+    struct timespec start, end;
+    guint64 sum_sq = 0, total = 0;
+    gint peak = 0;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for (gint i = 0; i < seconds * 100; i++) {
+        audio_meter_s16(buffer.data(), buffer.size(), &sum_sq, &peak);
+        total += sum_sq;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+
+    gdouble cpu_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    g_print("Audio meter (%s): %d s of 48 kHz stereo in %.3f ms CPU = %.4f%% of a core\n",
+#if defined(__SSE2__)
+            "SSE2",
+#elif defined(__aarch64__)
+            "NEON",
+#else
+            "scalar",
+#endif
+            seconds, cpu_s * 1000.0, cpu_s / seconds * 100.0);
+    g_print("Level %d dBov (checksum %" G_GUINT64_FORMAT ")\n",
+            -audio_level_dbov(sqrt((gdouble)sum_sq / buffer.size())), total);
+    return cpu_s / seconds < 0.01 ? 0 : 1;
+}
+
+// --bench-opus: encode a minute of pink noise, as fast as it goes, through
+// the first 1..n_audio_tiers tiers exactly as the capture pipeline builds
+// them. The step between runs is what each extra tier costs.
+static int opus_tier_bench() {
+    const gint seconds = 60;
+    gint tiers = config.n_audio_tiers;
+    gdouble previous_s = 0;
+    for (gint n = 1; n <= tiers; n++) {
+        config.n_audio_tiers = n;
+        gchar *source = g_strdup_printf("audiotestsrc wave=pink-noise volume=0.3 samplesperbuffer=960 "
+                                        "num-buffers=%d", seconds * 50);
+        GString *launch = g_string_new(NULL);
+        append_audio_tiers(launch, source, "", FALSE);
+        for (gint i = 0; i < n; i++) g_string_append_printf(launch, "audio_tee_%d. ! fakesink sync=false ", i);
+        g_free(source);
+
+        GError *error = NULL;
+        GstElement *bench = gst_parse_launch(launch->str, &error);
+        g_string_free(launch, TRUE);
+        if (error) {
+            g_printerr("Opus bench pipeline: %s\n", error->message);
+            g_error_free(error);
+            if (bench) gst_object_unref(bench);
+            return 1;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+        gst_element_set_state(bench, GST_STATE_PLAYING);
+        GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(bench));
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                                     (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+        gboolean failed = !msg || GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR;
+        if (msg) gst_message_unref(msg);
+        gst_object_unref(bus);
+        gst_element_set_state(bench, GST_STATE_NULL);
+        gst_object_unref(bench);
+        if (failed) {
+            g_printerr("Opus bench pipeline failed with %d tiers\n", n);
+            return 1;
+        }
+
+        gdouble cpu_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        g_print("Opus, %d tier%s: %.2f%% of a core; tier %d (%d kbps%s) adds %.2f%%\n",
+                n, n > 1 ? "s" : "", cpu_s / seconds * 100.0, n, config.audio_tier_kbps[n - 1],
+                config.audio_tier_kbps[n - 1] < 48 ? ", DTX" : "", (cpu_s - previous_s) / seconds * 100.0);
+        previous_s = cpu_s;
+    }
+    return 0;
+}
+
+// --bench-pacer: an in-process bottleneck. A producer thread sends 2 Mbps
+// of 30 fps video with a 50 KB keyframe every second to one consumer
+// thread per viewer queue. Each consumer runs pacer_probe() and then a
+// drop-tail shaper standing in for a shallow Wi-Fi hop. Three runs:
+// unpaced, paced, and paced with the first viewer throttled to a consumer
+// far slower than the stream. The throttled viewer's backlog must not
+// change what the others get.
+#define PACER_BENCH_PEERS 4
+#define PACER_BENCH_SECONDS 5
+#define PACER_BENCH_FPS 30
+#define PACER_BENCH_KBPS 2000
+#define PACER_BENCH_KEYFRAME (50 * 1024)
+#define PACER_BENCH_PACKET 1200
+#define PACER_BENCH_LINK_KBPS 4000
+#define PACER_BENCH_LINK_BUFFER (20 * 1024)
+// Per packet, about 1 Mbps
+#define PACER_BENCH_THROTTLE_US 10000
+
+struct PacerBenchPacket {
+    GstBuffer *buffer;
+    gint64 sent_us;
+    gboolean keyframe;
+};
+
+struct PacerBenchPeer {
+    GMutex lock;
+    GCond wake;
+    std::deque<PacerBenchPacket> queue;
+    gboolean done;
+    gint64 throttle_us;
+    Pacer *pacer;
+    // The shaper's queue, drained at the link rate since link_us
+    gint64 link_bytes;
+    gint64 link_us;
+    guint packets;
+    guint lost;
+    guint keyframe_packets;
+    guint keyframe_lost;
+    std::vector<gint64> latency_us;
+
+    PacerBenchPeer() : done(FALSE), throttle_us(0), pacer(NULL), link_bytes(0), link_us(0), packets(0),
+                       lost(0), keyframe_packets(0), keyframe_lost(0) {
+        g_mutex_init(&lock);
+        g_cond_init(&wake);
+    }
+    ~PacerBenchPeer() {
+        for (auto& packet : queue) gst_buffer_unref(packet.buffer);
+        g_mutex_clear(&lock);
+        g_cond_clear(&wake);
+    }
+};
+
+// Totals over a set of viewers
+struct PacerBenchResult {
+    guint packets;
+    guint lost;
+    guint keyframe_packets;
+    guint keyframe_lost;
+    gint64 p99_us;
+};
+
+static gpointer pacer_bench_consumer(gpointer data) {
+    PacerBenchPeer *peer = static_cast<PacerBenchPeer*>(data);
+    for (;;) {
+        g_mutex_lock(&peer->lock);
+        while (peer->queue.empty() && !peer->done) g_cond_wait(&peer->wake, &peer->lock);
+        // A throttled viewer never catches up; what it still holds is lost
+        if (peer->queue.empty() || (peer->done && peer->throttle_us)) {
+            peer->lost += peer->queue.size();
+            g_mutex_unlock(&peer->lock);
+            break;
+        }
+        PacerBenchPacket packet = peer->queue.front();
+        peer->queue.pop_front();
+        g_mutex_unlock(&peer->lock);
+
+        if (peer->throttle_us) g_usleep((gulong)peer->throttle_us);
+        GstPadProbeInfo info;
+        memset(&info, 0, sizeof(info));
+        info.type = GST_PAD_PROBE_TYPE_BUFFER;
+        info.data = packet.buffer;
+        gboolean dropped = pacer_probe(NULL, &info, peer->pacer) == GST_PAD_PROBE_DROP;
+
+        gint64 now = g_get_monotonic_time();
+        gint64 size = (gint64)gst_buffer_get_size(packet.buffer);
+        gint64 drained = (now - peer->link_us) * PACER_BENCH_LINK_KBPS / 8 / 1000;
+        peer->link_bytes = MAX(0, peer->link_bytes - drained);
+        peer->link_us = now;
+        if (!dropped && peer->link_bytes + size > PACER_BENCH_LINK_BUFFER) dropped = TRUE;
+
+        peer->packets++;
+        if (packet.keyframe) peer->keyframe_packets++;
+        if (dropped) {
+            peer->lost++;
+            if (packet.keyframe) peer->keyframe_lost++;
+        } else {
+            peer->link_bytes += size;
+            // Out the far side once the link has sent what is ahead of it
+            peer->latency_us.push_back(now - packet.sent_us + peer->link_bytes * 8 * 1000 / PACER_BENCH_LINK_KBPS);
+        }
+        gst_buffer_unref(packet.buffer);
+    }
+    return NULL;
+}
+
+static PacerBenchResult pacer_bench_sum(PacerBenchPeer *peers, gint first, gint last) {
+    PacerBenchResult result = { 0, 0, 0, 0, 0 };
+    std::vector<gint64> latency;
+    for (gint i = first; i < last; i++) {
+        result.packets += peers[i].packets;
+        result.lost += peers[i].lost;
+        result.keyframe_packets += peers[i].keyframe_packets;
+        result.keyframe_lost += peers[i].keyframe_lost;
+        latency.insert(latency.end(), peers[i].latency_us.begin(), peers[i].latency_us.end());
+    }
+    if (!latency.empty()) {
+        std::sort(latency.begin(), latency.end());
+        result.p99_us = latency[latency.size() * 99 / 100];
+    }
+    return result;
+}
+
+static void pacer_bench_print(const gchar *label, const PacerBenchResult& r) {
+    g_print("  %-18s keyframe loss %5.1f%%, loss %5.1f%%, p99 latency %6.1f ms (%u packets)\n", label,
+            r.keyframe_packets ? 100.0 * r.keyframe_lost / r.keyframe_packets : 0.0,
+            r.packets ? 100.0 * r.lost / r.packets : 0.0, r.p99_us / 1000.0, r.packets);
+}
+
+// Returns the totals of every viewer but the first
+static PacerBenchResult pacer_bench_run(const gchar *label, gdouble factor, gboolean throttle_first) {
+    VideoStream stream;
+    stream.bitrate_kbps.store(PACER_BENCH_KBPS);
+    config.pacing_factor = factor;
+    PacerBenchPeer peers[PACER_BENCH_PEERS];
+    GThread *threads[PACER_BENCH_PEERS];
+    for (gint i = 0; i < PACER_BENCH_PEERS; i++) {
+        peers[i].pacer = new Pacer(&stream);
+        peers[i].link_us = g_get_monotonic_time();
+        if (i == 0 && throttle_first) peers[i].throttle_us = PACER_BENCH_THROTTLE_US;
+        threads[i] = g_thread_new("bench-peer", pacer_bench_consumer, &peers[i]);
+    }
+
+    gint frame_bytes = (PACER_BENCH_KBPS * 1000 / 8 - PACER_BENCH_KEYFRAME) / (PACER_BENCH_FPS - 1);
+    gint64 start = g_get_monotonic_time();
+    for (gint f = 0; f < PACER_BENCH_SECONDS * PACER_BENCH_FPS; f++) {
+        gint64 due = start + (gint64)f * G_USEC_PER_SEC / PACER_BENCH_FPS;
+        gint64 now = g_get_monotonic_time();
+        if (due > now) g_usleep((gulong)(due - now));
+
+        gboolean keyframe = f % PACER_BENCH_FPS == 0;
+        gint bytes = keyframe ? PACER_BENCH_KEYFRAME : frame_bytes;
+        now = g_get_monotonic_time();
+        // The tee hands the whole frame to every queue at once
+        for (; bytes > 0; bytes -= PACER_BENCH_PACKET) {
+            GstBuffer *buffer = gst_buffer_new_allocate(NULL, MIN(bytes, PACER_BENCH_PACKET), NULL);
+            for (PacerBenchPeer& peer : peers) {
+                PacerBenchPacket packet = { gst_buffer_ref(buffer), now, keyframe };
+                g_mutex_lock(&peer.lock);
+                peer.queue.push_back(packet);
+                g_cond_signal(&peer.wake);
+                g_mutex_unlock(&peer.lock);
+            }
+            gst_buffer_unref(buffer);
+        }
+    }
+    for (PacerBenchPeer& peer : peers) {
+        g_mutex_lock(&peer.lock);
+        peer.done = TRUE;
+        g_cond_signal(&peer.wake);
+        g_mutex_unlock(&peer.lock);
+    }
+    for (GThread *thread : threads) g_thread_join(thread);
+
+    g_print("%s:\n", label);
+    PacerBenchResult others = pacer_bench_sum(peers, 1, PACER_BENCH_PEERS);
+    if (throttle_first) {
+        pacer_bench_print("throttled viewer", pacer_bench_sum(peers, 0, 1));
+        pacer_bench_print("other viewers", others);
+    } else {
+        pacer_bench_print("viewers", pacer_bench_sum(peers, 0, PACER_BENCH_PEERS));
+    }
+    for (PacerBenchPeer& peer : peers) delete peer.pacer;
+    return others;
+}
+
+static int pacer_bench() {
+    gdouble factor = config.pacing_factor > 0 ? config.pacing_factor : 2.5;
+    g_print("Pacer bench: %d viewers, %d kbps with a %d KiB keyframe each second, "
+            "link %d kbps with a %d KiB buffer\n",
+            PACER_BENCH_PEERS, PACER_BENCH_KBPS, PACER_BENCH_KEYFRAME / 1024,
+            PACER_BENCH_LINK_KBPS, PACER_BENCH_LINK_BUFFER / 1024);
+    PacerBenchResult unpaced = pacer_bench_run("Unpaced", 0, FALSE);
+    PacerBenchResult paced = pacer_bench_run("Paced", factor, FALSE);
+    PacerBenchResult throttled = pacer_bench_run("Paced, first viewer throttled", factor, TRUE);
+
+    gint failures = 0;
+    if (paced.keyframe_lost * 10 > paced.keyframe_packets ||
+        paced.keyframe_lost >= unpaced.keyframe_lost) {
+        g_printerr("Pacing did not cut keyframe loss\n");
+        failures++;
+    }
+    // Scheduling noise aside, the slow viewer must not touch the others
+    if (throttled.packets != paced.packets ||
+        throttled.lost > paced.lost + paced.packets / 100 ||
+        throttled.p99_us > paced.p99_us + 20 * 1000) {
+        g_printerr("A throttled viewer changed the others' delivery\n");
+        failures++;
+    }
+    return failures ? 1 : 0;
+}
+
+// --bench-shm=N: one capture, many workers. A test-pattern publisher encodes
+// 720p30 and the audio tiers once into shmsinks built as --shm-publish
+// builds them; then 1, 2, 4 .. N readers attach as --shm-attach does, each
+// its own pipeline. Every row gives process CPU and the share of published
+// video packets the worst reader saw. The encode is paid once, so the step
+// between rows is what one more worker's fan-out costs; its signaling and
+// per-viewer webrtcbins are not part of it.
+#define SHM_BENCH_WARMUP_MS   2000
+#define SHM_BENCH_MEASURE_MS  5000
+
+static GstPadProbeReturn shm_bench_count(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad; (void)info;
+    static_cast<std::atomic<guint64>*>(user_data)->fetch_add(1, std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstElement* shm_bench_launch(const gchar *description, std::atomic<guint64> *video_packets) {
+    GError *error = NULL;
+    GstElement *bin = gst_parse_launch(description, &error);
+    if (error) {
+        g_printerr("Shared-memory bench pipeline: %s\n", error->message);
+        g_error_free(error);
+        if (bin) gst_object_unref(bin);
+        return NULL;
+    }
+    GstElement *tee = gst_bin_get_by_name(GST_BIN(bin), "video_tee_0");
+    GstPad *sink = gst_element_get_static_pad(tee, "sink");
+    gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER, shm_bench_count, video_packets, NULL);
+    gst_object_unref(sink);
+    gst_object_unref(tee);
+    gst_element_set_state(bin, GST_STATE_PLAYING);
+    return bin;
+}
+
+// Takes the message; FALSE when there was none
+static gboolean shm_bench_error(GstMessage *msg) {
+    if (!msg) return FALSE;
+    GError *error = NULL;
+    gst_message_parse_error(msg, &error, NULL);
+    g_printerr("Shared-memory bench: %s: %s\n", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), error->message);
+    g_error_free(error);
+    gst_message_unref(msg);
+    return TRUE;
+}
+
+static gboolean shm_bench_failed(GstElement *bin) {
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(bin));
+    gboolean failed = shm_bench_error(gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR));
+    gst_object_unref(bus);
+    return failed;
+}
+
+static gdouble shm_bench_cpu_s() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int shm_bench() {
+    gint max_readers = bench_config.shm;
+    gboolean h265 = g_strcmp0(config.codec, "h265") == 0;
+    gchar *prefix = g_strdup_printf("%s/webrtc-bench-shm-%d", g_get_tmp_dir(), (int)getpid());
+    gchar *saved_publish = config.shm_publish, *saved_attach = config.shm_attach;
+    config.shm_publish = config.shm_attach = prefix;
+
+    GString *launch = g_string_new(NULL);
+    g_string_append_printf(launch,
+        "videotestsrc is-live=true pattern=ball ! video/x-raw,width=1280,height=720,framerate=30/1 ! "
+        "%s ! %s config-interval=-1 pt=96 mtu=1200 ! tee name=video_tee_0 allow-not-linked=true ",
+        h265 ? "x265enc tune=zerolatency speed-preset=ultrafast bitrate=2000 key-int-max=60"
+             : "x264enc tune=zerolatency speed-preset=ultrafast bitrate=2000 key-int-max=60",
+        h265 ? "rtph265pay" : "rtph264pay");
+    append_audio_tiers(launch, "audiotestsrc is-live=true wave=pink-noise volume=0.3 samplesperbuffer=960", "",
+                       FALSE);
+    append_shm_sinks(launch);
+    std::atomic<guint64> published(0);
+    GstElement *publisher = shm_bench_launch(launch->str, &published);
+    g_string_free(launch, TRUE);
+
+    gchar *video_caps = g_strdup_printf("application/x-rtp,media=video,encoding-name=%s,payload=96",
+                                        h265 ? "H265" : "H264");
+    launch = g_string_new(NULL);
+    append_shm_sources(launch, video_caps, "");
+    g_free(video_caps);
+
+    std::vector<GstElement*> readers;
+    std::vector<std::atomic<guint64>> received(max_readers);
+    gint failures = publisher ? 0 : 1;
+    gdouble alone_pct = 0;
+    GstBus *bus = publisher ? gst_pipeline_get_bus(GST_PIPELINE(publisher)) : NULL;
+    for (gint n = 0; bus && !failures; n = n ? MIN(n * 2, max_readers) : 1) {
+        while ((gint)readers.size() < n) {
+            GstElement *reader = shm_bench_launch(launch->str, &received[readers.size()]);
+            if (!reader) break;
+            readers.push_back(reader);
+        }
+        if ((gint)readers.size() < n) {
+            failures++;
+            break;
+        }
+
+        // The publisher's bus doubles as the clock: any error ends the wait
+        if (shm_bench_error(gst_bus_timed_pop_filtered(bus, SHM_BENCH_WARMUP_MS * GST_MSECOND,
+                                                       GST_MESSAGE_ERROR))) {
+            failures++;
+            break;
+        }
+        guint64 published_start = published.load(std::memory_order_relaxed);
+        std::vector<guint64> received_start;
+        for (gint i = 0; i < n; i++) received_start.push_back(received[i].load(std::memory_order_relaxed));
+        gdouble cpu_start = shm_bench_cpu_s();
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, SHM_BENCH_MEASURE_MS * GST_MSECOND, GST_MESSAGE_ERROR);
+        gdouble cpu_pct = (shm_bench_cpu_s() - cpu_start) * 100000.0 / SHM_BENCH_MEASURE_MS;
+        if (shm_bench_error(msg)) {
+            failures++;
+            break;
+        }
+        for (GstElement *reader : readers) failures += shm_bench_failed(reader);
+
+        guint64 sent = published.load(std::memory_order_relaxed) - published_start;
+        gdouble worst_pct = 100.0;
+        for (gint i = 0; i < n; i++) {
+            guint64 got = received[i].load(std::memory_order_relaxed) - received_start[i];
+            worst_pct = MIN(worst_pct, sent ? 100.0 * got / sent : 0.0);
+        }
+        if (n == 0) {
+            alone_pct = cpu_pct;
+            g_print("Shared memory, publisher alone: %.1f%% of a core, %" G_GUINT64_FORMAT " video packets\n",
+                    cpu_pct, sent);
+        } else {
+            g_print("Shared memory, %3d reader%s: %.1f%% of a core, +%.2f%% per reader, "
+                    "worst reader saw %.1f%% of %" G_GUINT64_FORMAT " packets\n",
+                    n, n > 1 ? "s" : " ", cpu_pct, (cpu_pct - alone_pct) / n, worst_pct, sent);
+        }
+        if (sent == 0) failures++;
+        if (n == max_readers) break;
+    }
+
+    if (bus) gst_object_unref(bus);
+    for (GstElement *reader : readers) {
+        gst_element_set_state(reader, GST_STATE_NULL);
+        gst_object_unref(reader);
+    }
+    if (publisher) {
+        gst_element_set_state(publisher, GST_STATE_NULL);
+        gst_object_unref(publisher);
+    }
+    g_string_free(launch, TRUE);
+    config.shm_publish = saved_publish;
+    config.shm_attach = saved_attach;
+    g_free(prefix);
+    return failures ? 1 : 0;
+}
+
+// ==================== Signaling Bench ====================
+//
+// --bench-signaling: a client thread opens SIGNALING_BENCH_JOINS WebSockets
+// one after another, timing each from the upgrade request to the server's
+// "registered", and sends SIGNALING_BENCH_MESSAGES audio-level messages on
+// each, whose queue delay to the control thread lands in
+// signaling_queue_delay. This runs once on an idle server and once while
+// SIGNALING_BENCH_LOADERS threads fetch /metrics and / back to back.
+
+#define SIGNALING_BENCH_JOINS 100
+#define SIGNALING_BENCH_MESSAGES 20
+#define SIGNALING_BENCH_LOADERS 8
+
+struct SignalingBench {
+    GMainLoop *loop;
+    SoupSession *session;
+    gint64 started_us;
+    std::vector<gint64> join_us;
+    std::atomic<gboolean> loading;
+    std::atomic<guint64> http_requests;
+    gint failures;
+
+    SignalingBench() : loop(NULL), session(NULL), started_us(0), loading(FALSE), http_requests(0),
+                       failures(0) {}
+};
+
+static SignalingBench signaling_bench;
+
+static gpointer signaling_bench_loader(gpointer user_data) {
+    (void)user_data;
+    static const char* const requests[] = {
+        "GET /metrics HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+    };
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((guint16)config.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (guint i = 0; signaling_bench.loading.load(); i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) break;
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            const char *request = requests[i % G_N_ELEMENTS(requests)];
+            if (write(fd, request, strlen(request)) > 0) {
+                gchar buf[4096];
+                while (read(fd, buf, sizeof(buf)) > 0) {}
+                signaling_bench.http_requests.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static void on_bench_ws_message(SoupWebsocketConnection *conn, SoupWebsocketDataType type,
+                                GBytes *message, gpointer user_data) {
+    (void)user_data;
+    gsize size = 0;
+    const gchar *data = static_cast<const gchar*>(g_bytes_get_data(message, &size));
+    if (type != SOUP_WEBSOCKET_DATA_TEXT || !g_strstr_len(data, size, "\"registered\"")) return;
+
+    signaling_bench.join_us.push_back(g_get_monotonic_time() - signaling_bench.started_us);
+    for (gint i = 0; i < SIGNALING_BENCH_MESSAGES; i++) {
+        soup_websocket_connection_send_text(conn, "{\"type\":\"audio-level\",\"enable\":false}");
+    }
+    soup_websocket_connection_close(conn, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+}
+
+static void on_bench_ws_closed(SoupWebsocketConnection *conn, gpointer user_data) {
+    (void)user_data;
+    g_object_unref(conn);
+    g_main_loop_quit(signaling_bench.loop);
+}
+
+static void on_bench_ws_connected(GObject *source, GAsyncResult *res, gpointer user_data) {
+    (void)user_data;
+    GError *error = NULL;
+    SoupWebsocketConnection *conn = soup_session_websocket_connect_finish(SOUP_SESSION(source), res, &error);
+    if (!conn) {
+        g_printerr("[Bench] WebSocket connect failed: %s\n", error->message);
+        g_error_free(error);
+        signaling_bench.failures++;
+        g_main_loop_quit(signaling_bench.loop);
+        return;
+    }
+    g_signal_connect(conn, "message", G_CALLBACK(on_bench_ws_message), NULL);
+    g_signal_connect(conn, "closed", G_CALLBACK(on_bench_ws_closed), NULL);
+}
+
+// Until the control thread has taken every message sent, or a second
+static gboolean signaling_bench_settled(gpointer user_data) {
+    guint64 expected = *static_cast<guint64*>(user_data);
+    if (signaling_queue_delay.count.load() < expected &&
+        g_get_monotonic_time() - signaling_bench.started_us < G_USEC_PER_SEC) {
+        return G_SOURCE_CONTINUE;
+    }
+    g_main_loop_quit(signaling_bench.loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void signaling_bench_round(const gchar *label) {
+    guint64 count = signaling_queue_delay.count.load();
+    guint64 total = signaling_queue_delay.total_us.load();
+    guint64 requests = signaling_bench.http_requests.load();
+    signaling_queue_delay.max_us.store(0);
+    signaling_bench.join_us.clear();
+    gchar *url = g_strdup_printf("ws://127.0.0.1:%u/ws", config.port);
+    gint64 start = g_get_monotonic_time();
+
+    for (gint i = 0; i < SIGNALING_BENCH_JOINS && !signaling_bench.failures; i++) {
+        SoupMessage *msg = soup_message_new("GET", url);
+        signaling_bench.started_us = g_get_monotonic_time();
+        soup_session_websocket_connect_async(signaling_bench.session, msg, NULL, NULL, NULL,
+                                             on_bench_ws_connected, NULL);
+        g_object_unref(msg);
+        g_main_loop_run(signaling_bench.loop);
+    }
+    guint64 expected = count + signaling_bench.join_us.size() * SIGNALING_BENCH_MESSAGES;
+    signaling_bench.started_us = g_get_monotonic_time();
+    GSource *settle = g_timeout_source_new(10);
+    g_source_set_callback(settle, signaling_bench_settled, &expected, NULL);
+    g_source_attach(settle, g_main_loop_get_context(signaling_bench.loop));
+    g_source_unref(settle);
+    g_main_loop_run(signaling_bench.loop);
+    gint64 elapsed_us = g_get_monotonic_time() - start;
+    g_free(url);
+
+    std::vector<gint64>& joins = signaling_bench.join_us;
+    if (joins.empty()) return;
+    std::sort(joins.begin(), joins.end());
+    guint64 delays = signaling_queue_delay.count.load() - count;
+    g_print("[Bench] %-7s join p50 %.2f ms, p99 %.2f ms, max %.2f ms; control queue delay "
+            "mean %.1f us, max %" G_GUINT64_FORMAT " us over %" G_GUINT64_FORMAT " messages; "
+            "%.0f HTTP req/s\n",
+            label, joins[joins.size() / 2] / 1000.0, joins[joins.size() * 99 / 100] / 1000.0,
+            joins.back() / 1000.0,
+            delays ? (gdouble)(signaling_queue_delay.total_us.load() - total) / delays : 0.0,
+            (guint64)signaling_queue_delay.max_us.load(), delays,
+            (signaling_bench.http_requests.load() - requests) * 1e6 / elapsed_us);
+}
+
+static gboolean signaling_bench_done(gpointer user_data) {
+    (void)user_data;
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer signaling_bench_main(gpointer user_data) {
+    (void)user_data;
+    GMainContext *context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+    signaling_bench.loop = g_main_loop_new(context, FALSE);
+    signaling_bench.session = soup_session_new();
+
+    signaling_bench_round("idle");
+
+    GThread *loaders[SIGNALING_BENCH_LOADERS];
+    signaling_bench.loading.store(TRUE);
+    for (GThread *&loader : loaders) loader = g_thread_new("bench-http", signaling_bench_loader, NULL);
+    signaling_bench_round("loaded");
+    signaling_bench.loading.store(FALSE);
+    for (GThread *loader : loaders) g_thread_join(loader);
+
+    g_object_unref(signaling_bench.session);
+    g_main_loop_unref(signaling_bench.loop);
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
+    g_idle_add(signaling_bench_done, NULL);
+    return NULL;
+}
+
+// ==================== Peer Soak ====================
+//
+// --soak=CYCLES: on the real pipeline, repeatedly add SOAK_PEERS viewers
+// (mixed media and streams, each creating an offer so webrtcbin gathers
+// ICE) and remove them again. After every cycle the open fds, tee request
+// pads, pipeline children, registry size and live PeerStates must be back
+// where they were after the first, warm-up cycle.
+
+#define SOAK_PEERS 8
+#define SOAK_STEP_MS 1000
+// Steps a cycle may wait for removal idles and promises to finish
+#define SOAK_SETTLE_STEPS 5
+
+// Synthetic viewers for the soak and load modes. They have no WebSocket, so
+// their offers go nowhere, but each gets its full tee branch and webrtcbin.
+// media 0 cycles through both, video and audio.
+static void synthetic_peers_add(const gchar *prefix, gint n, guint media) {
+    static const guint mixed[] = { PEER_MEDIA_BOTH, PEER_MEDIA_VIDEO, PEER_MEDIA_AUDIO };
+    for (gint i = 0; i < n; i++) {
+        gchar *id = g_strdup_printf("%s%03d", prefix, i);
+        gint stream = i % config.n_streams;
+        idle_resume(stream);
+        if (add_webrtc_peer(id, i % 2, media ? media : mixed[i % 3], stream, -1)) force_create_offer(id);
+        g_free(id);
+    }
+}
+
+static void synthetic_peers_remove(const gchar *prefix, gint n) {
+    for (gint i = 0; i < n; i++) {
+        gchar *id = g_strdup_printf("%s%03d", prefix, i);
+        remove_webrtc_peer(id);
+        g_free(id);
+    }
+}
+
+struct SoakSample {
+    gint fds;
+    gint sockets;
+    gint tee_pads;
+    gint children;
+    gint peers;
+    gint live;
+};
+
+struct PeerSoak {
+    gint cycle;
+    gint phase;
+    gint settle;
+    SoakSample baseline;
+    gint failures;
+
+    PeerSoak() : cycle(0), phase(0), settle(0), baseline(), failures(0) {}
+};
+
+static PeerSoak soak;
+
+static gint soak_tee_pads(GstElement *tee) {
+    if (!tee) return 0;
+    GST_OBJECT_LOCK(tee);
+    gint pads = tee->numsrcpads;
+    GST_OBJECT_UNLOCK(tee);
+    return pads;
+}
+
+static SoakSample soak_sample() {
+    SoakSample sample;
+    sample.fds = count_open_fds(&sample.sockets);
+    sample.tee_pads = 0;
+    for (gint i = 0; i < config.n_streams; i++) sample.tee_pads += soak_tee_pads(video_streams[i].tee);
+    for (gint i = 0; i < config.n_audio_tiers; i++) sample.tee_pads += soak_tee_pads(audio_tiers[i].tee);
+    GST_OBJECT_LOCK(pipeline);
+    sample.children = GST_BIN(pipeline)->numchildren;
+    GST_OBJECT_UNLOCK(pipeline);
+    sample.peers = peer_count.load(std::memory_order_relaxed);
+    sample.live = PeerState::live_objects.load(std::memory_order_relaxed);
+    return sample;
+}
+
+static gboolean soak_step(gpointer user_data) {
+    (void)user_data;
+    if (!pipeline && !build_base_pipeline()) {
+        g_printerr("[Soak] No pipeline to soak\n");
+        soak.failures++;
+        g_main_loop_quit(loop);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (soak.phase == 0) {
+        synthetic_peers_add("soak", SOAK_PEERS, 0);
+        soak.phase = 1;
+        return G_SOURCE_CONTINUE;
+    }
+    if (soak.phase == 1) {
+        synthetic_peers_remove("soak", SOAK_PEERS);
+        soak.phase = 2;
+        soak.settle = 0;
+        return G_SOURCE_CONTINUE;
+    }
+
+    SoakSample now = soak_sample();
+    if ((now.peers > 0 || now.live > 0) && ++soak.settle < SOAK_SETTLE_STEPS) return G_SOURCE_CONTINUE;
+
+    g_print("[Soak] cycle %d: %d fds (%d sockets), %d tee pads, %d elements, %d peers, %d live\n",
+            soak.cycle, now.fds, now.sockets, now.tee_pads, now.children, now.peers, now.live);
+    if (soak.cycle == 0) {
+        soak.baseline = now;
+    } else if (now.fds != soak.baseline.fds || now.tee_pads != soak.baseline.tee_pads ||
+               now.children != soak.baseline.children || now.peers != 0 || now.live != 0) {
+        g_printerr("[Soak] ✗ cycle %d did not return to baseline (%d fds, %d tee pads, %d elements)\n",
+                   soak.cycle, soak.baseline.fds, soak.baseline.tee_pads, soak.baseline.children);
+        soak.failures++;
+    }
+    soak.phase = 0;
+    if (++soak.cycle > bench_config.soak_cycles) {
+        g_print("[Soak] %d cycles of %d peers, %d failures\n", bench_config.soak_cycles, SOAK_PEERS, soak.failures);
+        g_main_loop_quit(loop);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// ==================== Subscription Load ====================
+//
+// --bench-media=N: the load generator for per-viewer media selection. On
+// the real pipeline, N synthetic viewers are added for each subscription
+// mix in turn (all video, all audio, all both, then an even mix). After
+// MEDIA_BENCH_SETTLE_US the process CPU and the bytes leaving the viewer
+// queues are sampled for MEDIA_BENCH_SAMPLE_US, along with the elements and
+// tee pads the mix costs, and the viewers are removed again. With no remote
+// end the packets stop at webrtcbin's unconnected transport, so this is the
+// encoder-to-egress cost that the selection saves, not network load.
+
+#define MEDIA_BENCH_STEP_MS 250
+#define MEDIA_BENCH_SETTLE_US (3 * G_USEC_PER_SEC)
+#define MEDIA_BENCH_SAMPLE_US (5 * G_USEC_PER_SEC)
+
+struct MediaBench {
+    gint mix;
+    gint phase;
+    gint64 phase_us;
+    guint64 cpu_ticks;
+    guint64 egress;
+    SoakSample idle;
+    gint failures;
+
+    MediaBench() : mix(0), phase(0), phase_us(0), cpu_ticks(0), egress(0), idle(), failures(0) {}
+};
+
+static MediaBench media_bench;
+
+static gboolean media_bench_step(gpointer user_data) {
+    (void)user_data;
+    static const guint mixes[] = { PEER_MEDIA_VIDEO, PEER_MEDIA_AUDIO, PEER_MEDIA_BOTH, 0 };
+    gint64 now = g_get_monotonic_time();
+    if (!pipeline && !build_base_pipeline()) {
+        g_printerr("[Bench] No pipeline to load\n");
+        media_bench.failures++;
+        g_main_loop_quit(loop);
+        return G_SOURCE_REMOVE;
+    }
+
+    switch (media_bench.phase) {
+        case 0:
+            // Without viewers: the baseline every mix is compared with
+            if (media_bench.mix == 0) media_bench.idle = soak_sample();
+            synthetic_peers_add("load", bench_config.media, mixes[media_bench.mix]);
+            media_bench.phase_us = now;
+            media_bench.phase = 1;
+            break;
+        case 1:
+            if (now - media_bench.phase_us < MEDIA_BENCH_SETTLE_US) break;
+            if (!read_process_cpu_ticks(&media_bench.cpu_ticks)) media_bench.cpu_ticks = 0;
+            media_bench.egress = egress_bytes.load(std::memory_order_relaxed);
+            media_bench.phase_us = now;
+            media_bench.phase = 2;
+            break;
+        case 2: {
+            if (now - media_bench.phase_us < MEDIA_BENCH_SAMPLE_US) break;
+            guint64 ticks = 0;
+            read_process_cpu_ticks(&ticks);
+            gdouble elapsed_s = (now - media_bench.phase_us) / 1e6;
+            gdouble cpu_pct = 100.0 * (ticks - media_bench.cpu_ticks) / sysconf(_SC_CLK_TCK) / elapsed_s;
+            gdouble kbps = (egress_bytes.load(std::memory_order_relaxed) - media_bench.egress) * 8 / 1000.0 /
+                           elapsed_s;
+            SoakSample loaded = soak_sample();
+            g_print("[Bench] %-11s x %d: CPU %5.1f%% of a core, egress %7.0f kbps, "
+                    "+%d elements, +%d tee pads, +%d fds\n",
+                    mixes[media_bench.mix] ? peer_media_name(mixes[media_bench.mix]) : "mixed",
+                    bench_config.media, cpu_pct, kbps, loaded.children - media_bench.idle.children,
+                    loaded.tee_pads - media_bench.idle.tee_pads, loaded.fds - media_bench.idle.fds);
+            synthetic_peers_remove("load", bench_config.media);
+            media_bench.phase = 3;
+            break;
+        }
+        default:
+            if (peer_count.load(std::memory_order_relaxed) > 0) break;
+            media_bench.phase = 0;
+            if (++media_bench.mix == (gint)G_N_ELEMENTS(mixes)) {
+                g_main_loop_quit(loop);
+                return G_SOURCE_REMOVE;
+            }
+            break;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// ==================== Join Bench ====================
+//
+// --bench-join=N: a client thread joins N viewers one after another over
+// loopback, each with its own WebSocket and a receiving webrtcbin in a
+// pipeline of its own. They ask for LAN mode, so the server only gathers
+// host candidates and the hosts need a private address. A join is timed from
+// request-offer to the viewer's ICE reaching CONNECTED. With all N up, the
+// UDP sockets bound inside --udp-ports (JOIN_BENCH_PORT_MIN and up unless
+// given) can only be the server's, since the client's ephemeral ports lie
+// elsewhere; that gives ICE sockets per peer. The fd count is the whole
+// process, both ends of every join. The round runs twice, first with log
+// lines written in place and then through the log queue, for join
+// throughput with and without the queue; the rate limit applies to both.
+
+// UDP sockets in this process bound to a local port within [min_port, max_port]
+static gint count_udp_sockets_in_range(gint min_port, gint max_port) {
+    GDir *fds = g_dir_open("/proc/self/fd", 0, NULL);
+    if (!fds) return -1;
+    gint count = 0;
+    const gchar *name;
+    while ((name = g_dir_read_name(fds))) {
+        int fd = atoi(name);
+        int type = 0;
+        socklen_t len = sizeof(type);
+        if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) != 0 || type != SOCK_DGRAM) continue;
+        struct sockaddr_storage addr;
+        len = sizeof(addr);
+        if (getsockname(fd, (struct sockaddr*)&addr, &len) != 0) continue;
+        gint port = addr.ss_family == AF_INET ? ntohs(((struct sockaddr_in*)&addr)->sin_port) :
+                    addr.ss_family == AF_INET6 ? ntohs(((struct sockaddr_in6*)&addr)->sin6_port) : 0;
+        if (port >= min_port && port <= max_port) count++;
+    }
+    g_dir_close(fds);
+    return count;
+}
+
+#define JOIN_BENCH_PORT_MIN 20000
+#define JOIN_BENCH_TIMEOUT_MS 10000
+
+struct JoinBenchViewer {
+    SoupWebsocketConnection *conn;
+    GstElement *webrtc;
+    GSource *retry;
+    gint64 requested_us;
+    // Set from webrtcbin's threads
+    std::atomic<gint64> joined_us;
+    std::atomic<gboolean> failed;
+    gint retries;
+
+    JoinBenchViewer() : conn(NULL), webrtc(NULL), retry(NULL), requested_us(0), joined_us(0), failed(FALSE),
+                        retries(0) {}
+};
+
+struct JoinBench {
+    GMainContext *context;
+    GMainLoop *loop;
+    SoupSession *session;
+    GstElement *pipeline;
+    // The viewer g_main_loop_run is waiting on
+    JoinBenchViewer *current;
+    gint failures;
+
+    JoinBench() : context(NULL), loop(NULL), session(NULL), pipeline(NULL), current(NULL), failures(0) {}
+};
+
+static JoinBench join_bench;
+
+struct JoinBenchOutbound {
+    JoinBenchViewer *viewer;
+    gchar *text;
+};
+
+static void join_bench_outbound_free(gpointer user_data) {
+    JoinBenchOutbound *out = static_cast<JoinBenchOutbound*>(user_data);
+    g_free(out->text);
+    g_free(out);
+}
+
+static gboolean join_bench_deliver(gpointer user_data) {
+    JoinBenchOutbound *out = static_cast<JoinBenchOutbound*>(user_data);
+    SoupWebsocketConnection *conn = out->viewer->conn;
+    if (conn && soup_websocket_connection_get_state(conn) == SOUP_WEBSOCKET_STATE_OPEN) {
+        soup_websocket_connection_send_text(conn, out->text);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Any thread: candidates and the answer come from webrtcbin's
+static void join_bench_send(JoinBenchViewer *viewer, JsonObject *msg) {
+    JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+    json_node_set_object(node, msg);
+    JoinBenchOutbound *out = g_new0(JoinBenchOutbound, 1);
+    out->viewer = viewer;
+    out->text = json_to_string(node, FALSE);
+    json_node_free(node);
+    g_main_context_invoke_full(join_bench.context, G_PRIORITY_DEFAULT, join_bench_deliver, out,
+                               join_bench_outbound_free);
+}
+
+// Bench thread: joined, failed or timed out, on to the next viewer
+static gboolean join_bench_finish(gpointer user_data) {
+    if (user_data == join_bench.current) g_main_loop_quit(join_bench.loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void join_bench_request(JoinBenchViewer *viewer) {
+    JsonObject *msg = json_object_new();
+    json_object_set_string_member(msg, "type", "request-offer");
+    json_object_set_boolean_member(msg, "internetMode", FALSE);
+    json_object_set_string_member(msg, "media", "both");
+    // Admission pushing back is part of the join, so a retry keeps the clock
+    if (!viewer->requested_us) viewer->requested_us = g_get_monotonic_time();
+    join_bench_send(viewer, msg);
+    json_object_unref(msg);
+}
+
+static gboolean join_bench_rerequest(gpointer user_data) {
+    JoinBenchViewer *viewer = static_cast<JoinBenchViewer*>(user_data);
+    g_source_unref(viewer->retry);
+    viewer->retry = NULL;
+    join_bench_request(viewer);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_join_bench_pad_added(GstElement *webrtc, GstPad *pad, gpointer user_data) {
+    (void)webrtc; (void)user_data;
+    if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC) return;
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+    g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add(GST_BIN(join_bench.pipeline), sink);
+    gst_element_sync_state_with_parent(sink);
+    GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_link(pad, sinkpad);
+    gst_object_unref(sinkpad);
+}
+
+static void on_join_bench_ice_candidate(GstElement *webrtc, guint mlineindex, gchar *candidate,
+                                        gpointer user_data) {
+    (void)webrtc;
+    JsonObject *ice = json_object_new();
+    json_object_set_string_member(ice, "candidate", candidate);
+    json_object_set_int_member(ice, "sdpMLineIndex", mlineindex);
+
+    JsonObject *msg = json_object_new();
+    json_object_set_string_member(msg, "type", "ice-candidate");
+    json_object_set_object_member(msg, "candidate", ice);
+    join_bench_send(static_cast<JoinBenchViewer*>(user_data), msg);
+    json_object_unref(msg);
+}
+
+static void on_join_bench_ice_state(GstElement *webrtc, GParamSpec *pspec, gpointer user_data) {
+    (void)pspec;
+    JoinBenchViewer *viewer = static_cast<JoinBenchViewer*>(user_data);
+    GstWebRTCICEConnectionState state;
+    g_object_get(webrtc, "ice-connection-state", &state, NULL);
+    if (state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED && !viewer->joined_us.load()) {
+        viewer->joined_us.store(g_get_monotonic_time());
+        g_main_context_invoke(join_bench.context, join_bench_finish, viewer);
+    } else if (state == GST_WEBRTC_ICE_CONNECTION_STATE_FAILED) {
+        viewer->failed.store(TRUE);
+        g_main_context_invoke(join_bench.context, join_bench_finish, viewer);
+    }
+}
+
+static void on_join_bench_answer_created(GstPromise *promise, gpointer user_data) {
+    JoinBenchViewer *viewer = static_cast<JoinBenchViewer*>(user_data);
+    GstWebRTCSessionDescription *answer = NULL;
+    const GstStructure *reply = gst_promise_get_reply(promise);
+    if (reply) gst_structure_get(reply, "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+    gst_promise_unref(promise);
+    if (!answer) {
+        viewer->failed.store(TRUE);
+        g_main_context_invoke(join_bench.context, join_bench_finish, viewer);
+        return;
+    }
+
+    GstPromise *local_promise = gst_promise_new();
+    g_signal_emit_by_name(viewer->webrtc, "set-local-description", answer, local_promise);
+    gst_promise_interrupt(local_promise);
+    gst_promise_unref(local_promise);
+
+    gchar *sdp_text = gst_sdp_message_as_text(answer->sdp);
+    JsonObject *msg = json_object_new();
+    json_object_set_string_member(msg, "type", "answer");
+    json_object_set_string_member(msg, "sdp", sdp_text);
+    join_bench_send(viewer, msg);
+    json_object_unref(msg);
+    g_free(sdp_text);
+    gst_webrtc_session_description_free(answer);
+}
+
+static void join_bench_answer(JoinBenchViewer *viewer, const gchar *sdp_text) {
+    GstSDPMessage *sdp;
+    gst_sdp_message_new(&sdp);
+    if (!sdp_text || gst_sdp_message_parse_buffer((guint8 *)sdp_text, strlen(sdp_text), sdp) != GST_SDP_OK) {
+        gst_sdp_message_free(sdp);
+        viewer->failed.store(TRUE);
+        join_bench_finish(viewer);
+        return;
+    }
+    viewer->webrtc = gst_element_factory_make("webrtcbin", NULL);
+    g_object_set(viewer->webrtc, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+    g_signal_connect(viewer->webrtc, "pad-added", G_CALLBACK(on_join_bench_pad_added), viewer);
+    g_signal_connect(viewer->webrtc, "on-ice-candidate", G_CALLBACK(on_join_bench_ice_candidate), viewer);
+    g_signal_connect(viewer->webrtc, "notify::ice-connection-state", G_CALLBACK(on_join_bench_ice_state), viewer);
+    gst_bin_add(GST_BIN(join_bench.pipeline), viewer->webrtc);
+    gst_element_sync_state_with_parent(viewer->webrtc);
+
+    GstWebRTCSessionDescription *offer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_OFFER, sdp);
+    GstPromise *promise = gst_promise_new();
+    g_signal_emit_by_name(viewer->webrtc, "set-remote-description", offer, promise);
+    gst_promise_interrupt(promise);
+    gst_promise_unref(promise);
+    gst_webrtc_session_description_free(offer);
+
+    promise = gst_promise_new_with_change_func(on_join_bench_answer_created, viewer, NULL);
+    g_signal_emit_by_name(viewer->webrtc, "create-answer", NULL, promise);
+}
+
+static void on_join_bench_message(SoupWebsocketConnection *conn, SoupWebsocketDataType type,
+                                  GBytes *message, gpointer user_data) {
+    (void)conn;
+    JoinBenchViewer *viewer = static_cast<JoinBenchViewer*>(user_data);
+    if (type != SOUP_WEBSOCKET_DATA_TEXT) return;
+
+    gsize size = 0;
+    const gchar *data = static_cast<const gchar*>(g_bytes_get_data(message, &size));
+    JsonParser *parser = json_parser_new();
+    if (!json_parser_load_from_data(parser, data, (gssize)size, NULL) ||
+        !JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser))) {
+        g_object_unref(parser);
+        return;
+    }
+    JsonObject *object = json_node_get_object(json_parser_get_root(parser));
+    const gchar *msg_type = json_object_get_string_member(object, "type");
+
+    if (g_strcmp0(msg_type, "registered") == 0) {
+        join_bench_request(viewer);
+
+    } else if (g_strcmp0(msg_type, "offer") == 0 && !viewer->webrtc) {
+        join_bench_answer(viewer, json_object_get_string_member(object, "sdp"));
+
+    } else if (g_strcmp0(msg_type, "ice-candidate") == 0 && viewer->webrtc &&
+               json_object_has_member(object, "candidate")) {
+        JsonObject *candidate_obj = json_object_get_object_member(object, "candidate");
+        const gchar *candidate = candidate_obj ? json_object_get_string_member(candidate_obj, "candidate") : NULL;
+        if (candidate && *candidate) {
+            g_signal_emit_by_name(viewer->webrtc, "add-ice-candidate",
+                                  (guint)json_object_get_int_member(candidate_obj, "sdpMLineIndex"), candidate);
+        }
+
+    } else if (g_strcmp0(msg_type, "retry-after") == 0 && !viewer->retry) {
+        gint64 delay_ms = json_object_has_member(object, "retryAfter") ?
+                          json_object_get_int_member(object, "retryAfter") : 1000;
+        viewer->retries++;
+        viewer->retry = g_timeout_source_new((guint)MAX(delay_ms, 100));
+        g_source_set_callback(viewer->retry, join_bench_rerequest, viewer, NULL);
+        g_source_attach(viewer->retry, join_bench.context);
+    }
+    g_object_unref(parser);
+}
+
+static void on_join_bench_closed(SoupWebsocketConnection *conn, gpointer user_data) {
+    (void)conn;
+    JoinBenchViewer *viewer = static_cast<JoinBenchViewer*>(user_data);
+    if (!viewer->joined_us.load()) viewer->failed.store(TRUE);
+    join_bench_finish(viewer);
+}
+
+static void on_join_bench_connected(GObject *source, GAsyncResult *res, gpointer user_data) {
+    JoinBenchViewer *viewer = static_cast<JoinBenchViewer*>(user_data);
+    GError *error = NULL;
+    viewer->conn = soup_session_websocket_connect_finish(SOUP_SESSION(source), res, &error);
+    if (!viewer->conn) {
+        g_printerr("[Bench] WebSocket connect failed: %s\n", error->message);
+        g_error_free(error);
+        viewer->failed.store(TRUE);
+        join_bench_finish(viewer);
+        return;
+    }
+    g_signal_connect(viewer->conn, "message", G_CALLBACK(on_join_bench_message), viewer);
+    g_signal_connect(viewer->conn, "closed", G_CALLBACK(on_join_bench_closed), viewer);
+}
+
+static gboolean join_bench_timeout(gpointer user_data) {
+    (void)user_data;
+    g_main_loop_quit(join_bench.loop);
+    return G_SOURCE_REMOVE;
+}
+
+// Runs the bench loop for ms, letting close frames and late callbacks through
+static void join_bench_settle(guint ms) {
+    join_bench.current = NULL;
+    GSource *settle = g_timeout_source_new(ms);
+    g_source_set_callback(settle, join_bench_timeout, NULL, NULL);
+    g_source_attach(settle, join_bench.context);
+    g_source_unref(settle);
+    g_main_loop_run(join_bench.loop);
+}
+
+struct JoinBenchBaseline {
+    gint fds;
+    gint sockets;
+    gint in_range;
+    guint64 log_suppressed;
+    guint64 log_dropped;
+    gint64 started_us;
+};
+
+static JoinBenchBaseline join_bench_baseline() {
+    JoinBenchBaseline base;
+    base.fds = count_open_fds(&base.sockets);
+    base.in_range = count_udp_sockets_in_range(config.udp_port_min, config.udp_port_max);
+    base.log_suppressed = log_queue.suppressed.load();
+    base.log_dropped = log_queue.dropped.load();
+    base.started_us = g_get_monotonic_time();
+    return base;
+}
+
+static void join_bench_report(const gchar *label, const std::vector<JoinBenchViewer*>& viewers,
+                              const JoinBenchBaseline& base) {
+    gint64 elapsed_us = g_get_monotonic_time() - base.started_us;
+    std::vector<gint64> joins;
+    gint retries = 0;
+    for (JoinBenchViewer *viewer : viewers) {
+        joins.push_back(viewer->joined_us.load() - viewer->requested_us);
+        retries += viewer->retries;
+    }
+    // In the first round the first join also builds the server's pipeline
+    gint64 first_us = joins.front();
+    std::sort(joins.begin(), joins.end());
+    gint n = (gint)joins.size();
+    g_print("[Bench] %-8s %d joins, %.1f joins/s: first %.1f ms, p50 %.1f ms, p95 %.1f ms, max %.1f ms, "
+            "%d retry-after; log lines suppressed %" G_GUINT64_FORMAT ", dropped %" G_GUINT64_FORMAT "\n",
+            label, n, n * 1e6 / elapsed_us, first_us / 1000.0, joins[n / 2] / 1000.0,
+            joins[n * 95 / 100] / 1000.0, joins.back() / 1000.0, retries,
+            log_queue.suppressed.load() - base.log_suppressed, log_queue.dropped.load() - base.log_dropped);
+
+    gint sockets = 0;
+    gint fds = count_open_fds(&sockets);
+    gint in_range = count_udp_sockets_in_range(config.udp_port_min, config.udp_port_max);
+    g_print("[Bench] %-8s UDP %d-%d: %d server ICE sockets, %.2f per peer; process +%d fds (+%d sockets), "
+            "%.2f per join counting both ends\n",
+            label, config.udp_port_min, config.udp_port_max, in_range - base.in_range,
+            (gdouble)(in_range - base.in_range) / n, fds - base.fds, sockets - base.sockets,
+            (gdouble)(fds - base.fds) / n);
+    if (in_range - base.in_range <= 0) {
+        g_printerr("[Bench] ✗ No ICE sockets in the UDP range: this libnice ignores min-rtp-port\n");
+        join_bench.failures++;
+    }
+}
+
+// Joins bench_config.join viewers, reports, and closes them again
+static void join_bench_round(const gchar *label) {
+    join_bench.pipeline = gst_pipeline_new("join-bench");
+    gst_element_set_state(join_bench.pipeline, GST_STATE_PLAYING);
+    JoinBenchBaseline base = join_bench_baseline();
+    gchar *url = g_strdup_printf("ws://127.0.0.1:%u/ws", config.port);
+    std::vector<JoinBenchViewer*> viewers;
+
+    for (gint i = 0; i < bench_config.join && !join_bench.failures; i++) {
+        JoinBenchViewer *viewer = new JoinBenchViewer();
+        viewers.push_back(viewer);
+        join_bench.current = viewer;
+        SoupMessage *msg = soup_message_new("GET", url);
+        soup_session_websocket_connect_async(join_bench.session, msg, NULL, NULL, NULL,
+                                             on_join_bench_connected, viewer);
+        g_object_unref(msg);
+        GSource *timeout = g_timeout_source_new(JOIN_BENCH_TIMEOUT_MS);
+        g_source_set_callback(timeout, join_bench_timeout, NULL, NULL);
+        g_source_attach(timeout, join_bench.context);
+        g_main_loop_run(join_bench.loop);
+        g_source_destroy(timeout);
+        g_source_unref(timeout);
+
+        if (!viewer->joined_us.load()) {
+            g_printerr("[Bench] ✗ %s: viewer %d %s\n", label, i + 1,
+                       viewer->failed.load() ? "failed to join" : "did not connect in time");
+            join_bench.failures++;
+        }
+    }
+    g_free(url);
+    if (!join_bench.failures) join_bench_report(label, viewers, base);
+
+    for (JoinBenchViewer *viewer : viewers) {
+        if (viewer->retry) g_source_destroy(viewer->retry);
+        if (!viewer->conn) continue;
+        g_signal_handlers_disconnect_by_data(viewer->conn, viewer);
+        soup_websocket_connection_close(viewer->conn, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    }
+    // Nothing calls back into a viewer once the pipeline is down and the
+    // sends it queued have run
+    gst_element_set_state(join_bench.pipeline, GST_STATE_NULL);
+    join_bench_settle(500);
+    for (JoinBenchViewer *viewer : viewers) {
+        if (viewer->retry) g_source_unref(viewer->retry);
+        if (viewer->conn) g_object_unref(viewer->conn);
+        delete viewer;
+    }
+    gst_object_unref(join_bench.pipeline);
+    join_bench.pipeline = NULL;
+
+    // The next round starts from a server with no peers
+    for (gint waited_ms = 0; peer_count.load() > 0 && waited_ms < JOIN_BENCH_TIMEOUT_MS; waited_ms += 100) {
+        join_bench_settle(100);
+    }
+}
+
+static gboolean join_bench_done(gpointer user_data) {
+    (void)user_data;
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+}
+
+// Once with every server_log() line written in place on the thread that
+// logs it, as all join-path logging was before the queue, and once queued
+static gpointer join_bench_main(gpointer user_data) {
+    (void)user_data;
+    join_bench.context = g_main_context_new();
+    g_main_context_push_thread_default(join_bench.context);
+    join_bench.loop = g_main_loop_new(join_bench.context, FALSE);
+    join_bench.session = soup_session_new();
+
+    log_stop();
+    join_bench_round("in place");
+    log_start();
+    if (!join_bench.failures) join_bench_round("queued");
+
+    g_object_unref(join_bench.session);
+    g_main_loop_unref(join_bench.loop);
+    g_main_context_pop_thread_default(join_bench.context);
+    g_main_context_unref(join_bench.context);
+    g_idle_add(join_bench_done, NULL);
+    return NULL;
+}
+
+// ==================== Main ====================
+
+// Bench options are taken out of argv here; the rest go to the server's own
+// parser. Flags take no value, counted options take =N or a following N.
+struct BenchOption {
+    const char *name;
+    gboolean *flag;
+    gint *count;
+    gint min, max;
+};
+
+static const BenchOption bench_options[] = {
+    { "bench-meter", &bench_config.meter, NULL, 0, 0 },
+    { "bench-opus", &bench_config.opus, NULL, 0, 0 },
+    { "bench-rtx", &bench_config.rtx, NULL, 0, 0 },
+    { "bench-pacer", &bench_config.pacer, NULL, 0, 0 },
+    { "bench-log", &bench_config.log, NULL, 0, 0 },
+    { "bench-candidates", &bench_config.candidates, NULL, 0, 0 },
+    { "stress-registry", &bench_config.stress_registry, NULL, 0, 0 },
+    { "bench-signaling", &bench_config.signaling, NULL, 0, 0 },
+    { "bench-media", NULL, &bench_config.media, 1, 999 },
+    { "bench-shm", NULL, &bench_config.shm, 1, 64 },
+    { "bench-join", NULL, &bench_config.join, 1, 500 },
+    { "soak", NULL, &bench_config.soak_cycles, 1, G_MAXINT },
+};
+
+static void bench_print_usage(const char *prog_name) {
+    g_print("Usage: %s BENCH [SERVER OPTIONS]\n", prog_name);
+    g_print("\nBenches; any server option may follow (see --help):\n");
+    g_print("  --bench-meter       Time the audio level meter and exit\n");
+    g_print("  --bench-opus        Time the Opus tiers one by one and exit\n");
+    g_print("  --bench-rtx         Check retransmission store memory and hits against viewer count and exit\n");
+    g_print("  --bench-pacer       Compare keyframe loss through a shallow bottleneck with and without\n");
+    g_print("                      pacing, throttle one viewer and check the others, and exit\n");
+    g_print("  --bench-log         Time synchronous against queued logging, then the queue from\n");
+    g_print("                      1-%d threads, and exit\n", LOG_BENCH_MAX_THREADS);
+    g_print("  --bench-candidates  Check and time the ICE candidate parser and exit\n");
+    g_print("  --stress-registry   Hammer the peer registry from several threads, check it and exit\n");
+    g_print("  --bench-signaling   Time WebSocket joins and control-thread delay, idle and under\n");
+    g_print("                      concurrent HTTP load, and exit\n");
+    g_print("  --bench-media=N     Load N synthetic viewers per subscription mix, report CPU,\n");
+    g_print("                      egress and elements for each and exit\n");
+    g_print("  --bench-shm=N       Attach up to N shared-memory readers to one test publisher,\n");
+    g_print("                      report CPU and delivery per reader count and exit\n");
+    g_print("  --bench-join=N      Join N LAN viewers over loopback with logging in place, then\n");
+    g_print("                      queued; report join rate and latency, ICE sockets and fds per\n");
+    g_print("                      peer and exit (--udp-ports default: %d-%d)\n",
+            JOIN_BENCH_PORT_MIN, JOIN_BENCH_PORT_MIN + 999);
+    g_print("  --soak=CYCLES       Add and remove %d synthetic viewers CYCLES times, check fds,\n", SOAK_PEERS);
+    g_print("                      pads and registry return to baseline and exit\n");
+    g_print("\n");
+}
+
+static gboolean bench_parse_arguments(int argc, char *argv[], GPtrArray *server_args) {
+    gboolean selected = FALSE, help = FALSE;
+    g_ptr_array_add(server_args, argv[0]);
+    for (int i = 1; i < argc; i++) {
+        const BenchOption *opt = NULL;
+        const char *value = NULL;
+        for (const BenchOption& o : bench_options) {
+            size_t len = strlen(o.name);
+            if (g_str_has_prefix(argv[i], "--") && strncmp(argv[i] + 2, o.name, len) == 0 &&
+                (argv[i][2 + len] == '\0' || argv[i][2 + len] == '=')) {
+                opt = &o;
+                if (argv[i][2 + len] == '=') value = argv[i] + 3 + len;
+            }
+        }
+        if (!opt) {
+            if (strcmp(argv[i], "--help") == 0) help = TRUE;
+            g_ptr_array_add(server_args, argv[i]);
+            continue;
+        }
+        if (opt->flag) {
+            if (value) {
+                g_printerr("Error: --%s takes no value\n", opt->name);
+                return FALSE;
+            }
+            *opt->flag = TRUE;
+        } else {
+            if (!value && i + 1 < argc) value = argv[++i];
+            if (!value) {
+                g_printerr("Error: --%s needs a value\n", opt->name);
+                return FALSE;
+            }
+            *opt->count = CLAMP(atoi(value), opt->min, opt->max);
+        }
+        selected = TRUE;
+    }
+    g_ptr_array_add(server_args, NULL);
+    // --help goes on to the server too, which lists its own options
+    if (help) {
+        bench_print_usage(argv[0]);
+        return TRUE;
+    }
+    if (!selected) {
+        g_printerr("Error: no bench given\n");
+        bench_print_usage(argv[0]);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean bench_configured(int *exit_code) {
+    if (bench_config.meter) {
+        *exit_code = audio_meter_bench();
+    } else if (bench_config.rtx) {
+        *exit_code = rtx_bench();
+    } else if (bench_config.pacer) {
+        *exit_code = pacer_bench();
+    } else if (bench_config.opus) {
+        *exit_code = opus_tier_bench();
+    } else if (bench_config.shm > 0) {
+        *exit_code = shm_bench();
+    } else if (bench_config.log) {
+        *exit_code = log_bench();
+    } else if (bench_config.candidates) {
+        *exit_code = candidate_bench();
+    } else if (bench_config.stress_registry) {
+        *exit_code = registry_stress();
+    } else {
+        // A suspend would change the element count between soak cycles,
+        // mixes or join rounds
+        if (bench_config.soak_cycles > 0 || bench_config.media > 0 || bench_config.join > 0) {
+            config.idle_grace_s = 0;
+        }
+        // Below the kernel's ephemeral ports, so the bench's own viewers bind elsewhere
+        if (bench_config.join > 0 && config.udp_port_max == 0) {
+            config.udp_port_min = JOIN_BENCH_PORT_MIN;
+            config.udp_port_max = JOIN_BENCH_PORT_MIN + 999;
+        }
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Against this server, over loopback; only joins need the pipeline
+static GThread *bench_thread = NULL;
+
+static void bench_started() {
+    if (bench_config.soak_cycles > 0) {
+        g_timeout_add(SOAK_STEP_MS, soak_step, NULL);
+    } else if (bench_config.media > 0) {
+        g_timeout_add(MEDIA_BENCH_STEP_MS, media_bench_step, NULL);
+    }
+    if (bench_config.signaling) {
+        bench_thread = g_thread_new("bench-client", signaling_bench_main, NULL);
+    } else if (bench_config.join > 0) {
+        bench_thread = g_thread_new("bench-client", join_bench_main, NULL);
+    }
+}
+
+static void bench_stopping() {
+    if (bench_thread) g_thread_join(bench_thread);
+    bench_thread = NULL;
+}
+
+static int bench_exit_code() {
+    return soak.failures || signaling_bench.failures || media_bench.failures || join_bench.failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    GPtrArray *server_args = g_ptr_array_new();
+    if (!bench_parse_arguments(argc, argv, server_args)) {
+        g_ptr_array_free(server_args, TRUE);
+        return -1;
+    }
+
+    ServerHooks hooks;
+    hooks.configured = bench_configured;
+    hooks.started = bench_started;
+    hooks.stopping = bench_stopping;
+    hooks.exit_code = bench_exit_code;
+    int status = server_main((int)server_args->len - 1, (char**)server_args->pdata, hooks);
+    g_ptr_array_free(server_args, TRUE);
+    return status;
+}